@@ -0,0 +1,330 @@
+#ifndef __at_h__
+#define __at_h__
+#include "Matrix.h"
+#include "PackedCache.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <limits>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <typeinfo>
+#include <functional>
+
+/*	Picks the serial or multithreaded version of multiply and transpose
+	from the shape of the operands, and the number of threads the threaded
+	version uses. Each element type has, for each operation, a threshold on
+	the amount of work (rows * inner * cols for a multiply, rows * cols for
+	a transpose) at which the threaded version starts to win, and a thread
+	count (0 meaning one per hardware thread).
+
+	These are measured on the target machine by calibrate() and saved to a
+	tuning file, which is loaded the first time a type is used. The file is
+	named by the MATRIX_TUNING_FILE environment variable or defaults to
+	matrix_tuning.txt. Each line is
+		<type> <mult_threshold> <transpose_threshold> <mult_threads> <transpose_threads>
+	where <type> is typeid(T).name(), so one file holds every element type.
+	The thread counts may be left off, in which case they are 0.
+*/
+template <class T>
+class AutoTuner{
+public:
+	typedef unsigned long long work_type;
+
+	//Returns the tuner for T, loading its thresholds on first use
+	static AutoTuner& instance(){
+		static AutoTuner tuner;
+		return tuner;
+	}
+
+	//Returns the tuning file named by MATRIX_TUNING_FILE, or the default
+	static std::string tuning_file(){
+		const char* path = std::getenv("MATRIX_TUNING_FILE");
+		return path ? std::string(path) : std::string("matrix_tuning.txt");
+	}
+
+	bool use_threaded_mult(work_type rows, work_type inner, work_type cols) const{
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		return rows * inner * cols >= m_mult_threshold;
+	}
+	bool use_threaded_transpose(work_type rows, work_type cols) const{
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		return rows * cols >= m_transpose_threshold;
+	}
+	unsigned mult_threads() const{
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		return m_mult_threads;
+	}
+	unsigned transpose_threads() const{
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		return m_transpose_threads;
+	}
+
+	/*
+		For each operation, picks the fastest thread count for the threaded
+		version on a large square matrix, then times both versions on
+		square matrices of growing size with that thread count. The
+		threshold is the smallest size from which the threaded version wins
+		at every larger size tried; if it doesn't win at the largest listed
+		size, larger ones are tried up to a time and size cap. With a single
+		hardware thread the threaded versions are never chosen. Does not
+		save.
+	*/
+	void calibrate(){
+		if (std::thread::hardware_concurrency() <= 1){
+			std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+			m_mult_threshold = never();
+			m_transpose_threshold = never();
+			m_mult_threads = 1;
+			m_transpose_threads = 1;
+			return;
+		}
+		const unsigned mult_sizes[] = {8, 16, 32, 64, 96, 128, 192, 256, 384};
+		const unsigned transpose_sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048};
+
+		std::function<double(unsigned)> mult_serial = [](unsigned n){
+			Matrix<T> a (n, n, T(1));
+			Matrix<T> b (n, n, T(1));
+			return best_of([&](){ a * b; });
+		};
+		std::function<double(unsigned, unsigned)> mult_threaded =
+			[](unsigned n, unsigned num_threads){
+			Matrix<T> a (n, n, T(1));
+			Matrix<T> b (n, n, T(1));
+			//drop b's packed copy so every run pays for packing, as a call
+			//with a new rhs would
+			return best_of([&](){
+				PackedCache<T>::instance().erase(b.version());
+				a.fast_mult(b, num_threads);
+			});
+		};
+		std::function<double(unsigned)> transpose_serial = [](unsigned n){
+			Matrix<T> a (n, n, T(1));
+			return best_of([&](){ a.transpose(); });
+		};
+		std::function<double(unsigned, unsigned)> transpose_threaded =
+			[](unsigned n, unsigned num_threads){
+			Matrix<T> a (n, n, T(1));
+			return best_of([&](){ a.transpose('m', num_threads); });
+		};
+
+		std::vector<unsigned> sizes (mult_sizes, 
+			mult_sizes + sizeof(mult_sizes) / sizeof(unsigned));
+		const unsigned mult_threads = fastest_thread_count(sizes.back(), mult_threaded);
+		const work_type mult_threshold = find_threshold(sizes, 3, mult_serial, 
+			mult_threaded, mult_threads);
+		sizes.assign(transpose_sizes, 
+			transpose_sizes + sizeof(transpose_sizes) / sizeof(unsigned));
+		const unsigned transpose_threads = fastest_thread_count(sizes.back(), 
+			transpose_threaded);
+		const work_type transpose_threshold = find_threshold(sizes, 2, 
+			transpose_serial, transpose_threaded, transpose_threads);
+
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		m_mult_threshold = mult_threshold;
+		m_transpose_threshold = transpose_threshold;
+		m_mult_threads = mult_threads;
+		m_transpose_threads = transpose_threads;
+	}
+
+	//Writes this type's thresholds and thread counts to the tuning file at path, keeping the
+	//lines of every other type. Returns false if the file can't be written.
+	bool save(const std::string& path) const{
+		std::map<std::string, std::string> lines = read_lines(path);
+		{
+			std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+			std::ostringstream a_line;
+			a_line << m_mult_threshold << " " << m_transpose_threshold << " " 
+				<< m_mult_threads << " " << m_transpose_threads;
+			lines[typeid(T).name()] = a_line.str();
+		}
+		std::ofstream out (path.c_str());
+		if (!out){
+			std::cerr << "Unable to write tuning file " << path << std::endl;
+			return false;
+		}
+		for (std::map<std::string, std::string>::const_iterator it = lines.begin();
+			it != lines.end();++it){
+			out << it->first << " " << it->second << std::endl;
+		}
+		return bool(out);
+	}
+
+	//Replaces the thresholds and thread counts with this type's line in the
+	//tuning file at path. Returns false, leaving them unchanged, if there is
+	//no such line or it is malformed.
+	bool load(const std::string& path){
+		std::map<std::string, std::string> lines = read_lines(path);
+		std::map<std::string, std::string>::const_iterator it =
+			lines.find(typeid(T).name());
+		if (it == lines.end()){
+			return false;
+		}
+		std::istringstream a_line (it->second);
+		work_type mult_threshold, transpose_threshold;
+		unsigned mult_threads = 0, transpose_threads = 0;
+		bool well_formed = bool(a_line >> mult_threshold >> transpose_threshold);
+		//the thread counts are optional, but must be complete if present
+		if (well_formed && !(a_line >> std::ws).eof()){
+			well_formed = bool(a_line >> mult_threads >> transpose_threads)
+				&& (a_line >> std::ws).eof();
+		}
+		if (!well_formed){
+			std::cerr << "Malformed tuning entry for " << typeid(T).name() << std::endl;
+			return false;
+		}
+		std::lock_guard<std::mutex> tuner_lck (m_tuner_mtx);
+		m_mult_threshold = mult_threshold;
+		m_transpose_threshold = transpose_threshold;
+		m_mult_threads = mult_threads;
+		m_transpose_threads = transpose_threads;
+		return true;
+	}
+
+private:
+	//Threshold of an operation whose threaded version never wins
+	static work_type never(){
+		return std::numeric_limits<work_type>::max();
+	}
+
+	//Untuned defaults. With a single hardware thread the threaded versions
+	//only add overhead, so they are never chosen.
+	AutoTuner():
+		m_mult_threshold(std::thread::hardware_concurrency() > 1 ? 64 * 64 * 64 : never()),
+		m_transpose_threshold(std::thread::hardware_concurrency() > 1 ? 1024 * 1024 : never()),
+		m_mult_threads(0),
+		m_transpose_threads(0)
+	{
+		load(tuning_file());
+	}
+	AutoTuner(const AutoTuner& other);
+	AutoTuner& operator=(const AutoTuner& other);
+
+	//Returns the fastest of a few runs of op in seconds
+	template <class Op>
+	static double best_of(Op op){
+		double best = std::numeric_limits<double>::max();
+		for (unsigned i = 0;i<3;++i){
+			std::chrono::high_resolution_clock::time_point start =
+				std::chrono::high_resolution_clock::now();
+			op();
+			std::chrono::duration<double> elapsed =
+				std::chrono::high_resolution_clock::now() - start;
+			if (elapsed.count() < best){
+				best = elapsed.count();
+			}
+		}
+		return best;
+	}
+
+	//Returns the thread count, out of powers of two below the number of
+	//hardware threads and that number itself, for which threaded(n, count)
+	//is fastest.
+	static unsigned fastest_thread_count(unsigned n, 
+		const std::function<double(unsigned, unsigned)>& threaded){
+		const unsigned hw_threads = std::thread::hardware_concurrency();
+		unsigned best_count = hw_threads;
+		double best_time = threaded(n, hw_threads);
+		for (unsigned count = 2;count<hw_threads;count *= 2){
+			double time = threaded(n, count);
+			if (time < best_time){
+				best_time = time;
+				best_count = count;
+			}
+		}
+		return best_count;
+	}
+
+	/*
+		Times serial(n) and threaded(n, num_threads) on each of sizes. If
+		the threaded version doesn't win at the last size, keeps trying
+		sizes 3/2 as large until it does, the serial version takes longer
+		than max_seconds, or twice the last listed size is passed. Returns
+		n^exponent for the smallest n from which the threaded version won
+		at every larger size, or just past the largest size tried if it
+		didn't win there.
+	*/
+	static work_type find_threshold(std::vector<unsigned> sizes, unsigned exponent,
+		const std::function<double(unsigned)>& serial,
+		const std::function<double(unsigned, unsigned)>& threaded, unsigned num_threads){
+		const double max_seconds = 0.5;
+		const unsigned max_size = sizes.back() * 2;
+		std::vector<bool> threaded_wins;
+		double serial_time = 0;
+		for (size_t i = 0;;++i){
+			if (i == sizes.size()){
+				if (threaded_wins.back() || serial_time > max_seconds 
+					|| sizes.back() * 3 / 2 > max_size){
+					break;
+				}
+				sizes.push_back(sizes.back() * 3 / 2);
+			}
+			serial_time = serial(sizes[i]);
+			threaded_wins.push_back(threaded(sizes[i], num_threads) < serial_time);
+		}
+		work_type threshold = work(sizes.back(), exponent) + 1;
+		for (int i = int(sizes.size()) - 1;i>=0 && threaded_wins[i];--i){
+			threshold = work(sizes[i], exponent);
+		}
+		return threshold;
+	}
+
+	//Returns n^exponent
+	static work_type work(unsigned n, unsigned exponent){
+		work_type result = 1;
+		for (unsigned i = 0;i<exponent;++i){
+			result *= n;
+		}
+		return result;
+	}
+
+	//Returns the lines of the tuning file keyed by type name. A missing
+	//file gives no lines.
+	static std::map<std::string, std::string> read_lines(const std::string& path){
+		std::map<std::string, std::string> lines;
+		std::ifstream in (path.c_str());
+		std::string a_line;
+		while (std::getline(in, a_line)){
+			std::istringstream fields (a_line);
+			std::string type_name, rest;
+			if (fields >> type_name && std::getline(fields >> std::ws, rest)){
+				lines[type_name] = rest;
+			}
+		}
+		return lines;
+	}
+
+	work_type m_mult_threshold;      //work from which fast_mult is used
+	work_type m_transpose_threshold; //work from which transpose('m') is used
+	unsigned m_mult_threads;         //threads fast_mult uses, 0 for all
+	unsigned m_transpose_threads;    //threads transpose('m') uses, 0 for all
+	mutable std::mutex m_tuner_mtx;
+};
+
+//Multiplies lhs by rhs with whichever of operator* and fast_mult the
+//tuner expects to be faster for their shapes, using the tuned thread count.
+template <class T>
+Matrix<T> auto_mult(Matrix<T>& lhs, Matrix<T>& rhs){
+	AutoTuner<T>& tuner = AutoTuner<T>::instance();
+	if (tuner.use_threaded_mult(lhs.numRows(), lhs.numCols(), rhs.numCols())){
+		return lhs.fast_mult(rhs, tuner.mult_threads());
+	}
+	return lhs * rhs;
+}
+
+//Transposes a_matrix with whichever of transpose() and transpose('m') the
+//tuner expects to be faster for its shape, using the tuned thread count.
+template <class T>
+Matrix<T> auto_transpose(Matrix<T>& a_matrix){
+	AutoTuner<T>& tuner = AutoTuner<T>::instance();
+	if (tuner.use_threaded_transpose(a_matrix.numRows(), a_matrix.numCols())){
+		return a_matrix.transpose('m', tuner.transpose_threads());
+	}
+	return a_matrix.transpose();
+}
+#endif
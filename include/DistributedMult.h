@@ -0,0 +1,329 @@
+#ifndef __dm_h__
+#define __dm_h__
+#include "Matrix.h"
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <type_traits>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*	Multi-process SUMMA multiply. The operands are split into a
+	grid_dim x grid_dim grid of blocks and one worker process is forked per
+	block of the result. The calling process scatters block (i,j) of both
+	operands to worker (i,j), which from then on only reads its own blocks.
+	On step k worker (i,k) broadcasts its lhs block along grid row i and
+	worker (k,j) broadcasts its rhs block down grid column j; every worker
+	then multiplies the two panels it received with fast_mult, so each
+	process still uses its own ThreadPool for the block product. Each
+	worker's pool is capped to its share of the hardware threads.
+
+	This is a shared-memory-only implementation: blocks, panels and the
+	result live in an anonymous shared memory segment, workers synchronise
+	on a process-shared barrier in that segment and write their result
+	blocks straight into it, so it only runs on a single Linux machine.
+	Running across machines needs a new transport for the scatter, the
+	panel broadcasts, the barrier and the gather.
+
+	Limits: T must be trivially copyable since blocks are copied as raw
+	bytes. The workers are created with fork(), which only copies the
+	calling thread, so summa_mult must not be called while other threads
+	of the process are running (e.g. a concurrent fast_mult); a lock they
+	held would stay locked forever in the workers.
+*/
+
+//Describes the shared memory segment shared by all worker processes.
+//Offsets are in bytes from the start of the segment.
+struct SummaLayout{
+	unsigned m, n, p;        //lhs is m x n, rhs is n x p
+	size_t barrier_offset;   //process-shared pthread barrier
+	size_t lhs_block_offset; //grid_dim^2 scattered lhs blocks, one per worker
+	size_t rhs_block_offset; //grid_dim^2 scattered rhs blocks, one per worker
+	size_t row_panel_offset; //grid_dim lhs panels, one per grid row
+	size_t col_panel_offset; //grid_dim rhs panels, one per grid column
+	size_t result_offset;    //the full result, row-major
+	size_t row_panel_size;   //bytes reserved for each lhs block or panel
+	size_t col_panel_size;   //bytes reserved for each rhs block or panel
+	size_t total_size;
+};
+
+//Returns the first index of the part'th of num_parts near-equal pieces of
+//a dimension of length len. summa_split(len, n, n) == len.
+inline unsigned summa_split(unsigned len, unsigned part, unsigned num_parts){
+	return unsigned((unsigned long long)(len) * part / num_parts);
+}
+
+//Rounds offset up so the next region is suitably aligned for any type.
+inline size_t summa_align(size_t offset){
+	const size_t align = alignof(std::max_align_t);
+	return (offset + align - 1) / align * align;
+}
+
+//Copies block [row_begin,row_end) x [col_begin,col_end) of m into the
+//panel buffer in row-major order.
+template <class T>
+void summa_send_panel(const std::vector<std::vector<T> >& m, unsigned row_begin,
+	unsigned row_end, unsigned col_begin, unsigned col_end, T* panel){
+	const unsigned width = col_end - col_begin;
+	if (width == 0){
+		return;
+	}
+	for (unsigned i = row_begin;i<row_end;++i){
+		std::memcpy(panel + size_t(i - row_begin) * width, &m[i][col_begin],
+			sizeof(T) * width);
+	}
+}
+
+//Copies a row-major panel buffer into block, which must already have the
+//panel's dimensions.
+template <class T>
+void summa_recv_panel(const T* panel, std::vector<std::vector<T> >& block){
+	if (block.empty() || block[0].empty()){
+		return;
+	}
+	for (size_t i = 0;i<block.size();++i){
+		const size_t width = block[i].size();
+		std::memcpy(block[i].data(), panel + i * width, sizeof(T) * width);
+	}
+}
+
+/*
+	Body of worker (grid_row, grid_col). Takes its own blocks out of the
+	segment, runs the grid_dim SUMMA steps and writes the finished result
+	block into the shared result.
+*/
+template <class T>
+void summa_worker(char* segment, const SummaLayout& layout, unsigned grid_dim,
+	unsigned grid_row, unsigned grid_col){
+	const size_t worker = size_t(grid_row) * grid_dim + grid_col;
+	pthread_barrier_t* barrier =
+		reinterpret_cast<pthread_barrier_t*>(segment + layout.barrier_offset);
+	const T* lhs_block = reinterpret_cast<const T*>(segment + layout.lhs_block_offset
+		+ worker * layout.row_panel_size);
+	const T* rhs_block = reinterpret_cast<const T*>(segment + layout.rhs_block_offset
+		+ worker * layout.col_panel_size);
+	T* row_panel = reinterpret_cast<T*>(segment + layout.row_panel_offset
+		+ grid_row * layout.row_panel_size);
+	T* col_panel = reinterpret_cast<T*>(segment + layout.col_panel_offset
+		+ grid_col * layout.col_panel_size);
+	T* result = reinterpret_cast<T*>(segment + layout.result_offset);
+
+	const unsigned row_begin = summa_split(layout.m, grid_row, grid_dim);
+	const unsigned row_end = summa_split(layout.m, grid_row + 1, grid_dim);
+	const unsigned col_begin = summa_split(layout.p, grid_col, grid_dim);
+	const unsigned col_end = summa_split(layout.p, grid_col + 1, grid_dim);
+
+	//this worker's blocks: lhs (grid_row,grid_col) and rhs (grid_row,grid_col)
+	Matrix<T> own_lhs (row_end - row_begin, summa_split(layout.n, grid_col + 1, grid_dim)
+		- summa_split(layout.n, grid_col, grid_dim));
+	Matrix<T> own_rhs (summa_split(layout.n, grid_row + 1, grid_dim)
+		- summa_split(layout.n, grid_row, grid_dim), col_end - col_begin);
+	summa_recv_panel(lhs_block, own_lhs.m_data);
+	summa_recv_panel(rhs_block, own_rhs.m_data);
+
+	Matrix<T> accum (row_end - row_begin, col_end - col_begin);
+	for (unsigned k = 0;k<grid_dim;++k){
+		const unsigned inner_begin = summa_split(layout.n, k, grid_dim);
+		const unsigned inner_end = summa_split(layout.n, k + 1, grid_dim);
+		//owners of block (grid_row,k) of lhs and (k,grid_col) of rhs broadcast
+		if (grid_col == k){
+			summa_send_panel(own_lhs.m_data, 0, own_lhs.m_num_rows, 0,
+				own_lhs.m_num_cols, row_panel);
+		}
+		if (grid_row == k){
+			summa_send_panel(own_rhs.m_data, 0, own_rhs.m_num_rows, 0,
+				own_rhs.m_num_cols, col_panel);
+		}
+		pthread_barrier_wait(barrier);
+
+		if (inner_end > inner_begin && row_end > row_begin && col_end > col_begin){
+			Matrix<T> a_blk (row_end - row_begin, inner_end - inner_begin);
+			Matrix<T> b_blk (inner_end - inner_begin, col_end - col_begin);
+			summa_recv_panel(row_panel, a_blk.m_data);
+			summa_recv_panel(col_panel, b_blk.m_data);
+			Matrix<T> c_blk = a_blk.fast_mult(b_blk);
+			for (unsigned i = 0;i<accum.m_num_rows;++i){
+				for (unsigned j = 0;j<accum.m_num_cols;++j){
+					accum.m_data[i][j] += c_blk.m_data[i][j];
+				}
+			}
+		}
+		//panels may only be overwritten once every reader is done with them
+		pthread_barrier_wait(barrier);
+	}
+
+	for (unsigned i = 0;i<accum.m_num_rows;++i){
+		for (unsigned j = 0;j<accum.m_num_cols;++j){
+			result[size_t(row_begin + i) * layout.p + col_begin + j] = accum.m_data[i][j];
+		}
+	}
+}
+
+/*
+	Multiplies lhs by rhs with grid_dim * grid_dim worker processes using
+	SUMMA. The calling process only forks the workers, waits for them and
+	gathers the result.
+*/
+template <class T>
+Matrix<T> summa_mult(Matrix<T>& lhs, Matrix<T>& rhs, unsigned grid_dim){
+	static_assert(std::is_trivially_copyable<T>::value,
+		"summa_mult requires a trivially copyable element type");
+	if (&lhs == &rhs){
+		std::cerr << "Incompatible: cannot multiply self" << std::endl;
+		throw;
+	}
+	if (grid_dim == 0){
+		std::cerr << "Process grid must have at least one process" << std::endl;
+		throw;
+	}
+
+	std::lock(lhs.m_matrix_mtx, rhs.m_matrix_mtx);
+	std::lock_guard<std::mutex> lhs_lck (lhs.m_matrix_mtx, std::adopt_lock);
+	std::lock_guard<std::mutex> rhs_lck (rhs.m_matrix_mtx, std::adopt_lock);
+
+	//confirm matrices are appropriate size
+	if (lhs.m_num_cols != rhs.m_num_rows){
+		std::cerr << "Incompatible matrices given to multiply" << std::endl;
+		throw;
+	}
+
+	const unsigned m = lhs.m_num_rows, n = lhs.m_num_cols, p = rhs.m_num_cols;
+	const unsigned num_workers = grid_dim * grid_dim;
+	//largest block along each dimension, used to size the panel buffers
+	const size_t max_m = summa_split(m, 1, grid_dim) + 1;
+	const size_t max_n = summa_split(n, 1, grid_dim) + 1;
+	const size_t max_p = summa_split(p, 1, grid_dim) + 1;
+
+	SummaLayout layout;
+	layout.m = m;
+	layout.n = n;
+	layout.p = p;
+	layout.row_panel_size = summa_align(max_m * max_n * sizeof(T));
+	layout.col_panel_size = summa_align(max_n * max_p * sizeof(T));
+	layout.barrier_offset = 0;
+	layout.lhs_block_offset = summa_align(sizeof(pthread_barrier_t));
+	layout.rhs_block_offset = layout.lhs_block_offset + num_workers * layout.row_panel_size;
+	layout.row_panel_offset = layout.rhs_block_offset + num_workers * layout.col_panel_size;
+	layout.col_panel_offset = layout.row_panel_offset + grid_dim * layout.row_panel_size;
+	layout.result_offset = layout.col_panel_offset + grid_dim * layout.col_panel_size;
+	layout.total_size = layout.result_offset + size_t(m) * p * sizeof(T);
+
+	void* mapped = mmap(nullptr, layout.total_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED){
+		std::cerr << "Unable to map shared memory for distributed multiply" << std::endl;
+		throw;
+	}
+	char* segment = static_cast<char*>(mapped);
+	pthread_barrier_t* barrier =
+		reinterpret_cast<pthread_barrier_t*>(segment + layout.barrier_offset);
+
+	pthread_barrierattr_t barrier_attr;
+	pthread_barrierattr_init(&barrier_attr);
+	pthread_barrierattr_setpshared(&barrier_attr, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(barrier, &barrier_attr, num_workers);
+	pthread_barrierattr_destroy(&barrier_attr);
+
+	//scatter block (i,j) of each operand to worker (i,j)
+	for (unsigned w = 0;w<num_workers;++w){
+		const unsigned grid_row = w / grid_dim, grid_col = w % grid_dim;
+		summa_send_panel(lhs.m_data, summa_split(m, grid_row, grid_dim),
+			summa_split(m, grid_row + 1, grid_dim), summa_split(n, grid_col, grid_dim),
+			summa_split(n, grid_col + 1, grid_dim),
+			reinterpret_cast<T*>(segment + layout.lhs_block_offset + w * layout.row_panel_size));
+		summa_send_panel(rhs.m_data, summa_split(n, grid_row, grid_dim),
+			summa_split(n, grid_row + 1, grid_dim), summa_split(p, grid_col, grid_dim),
+			summa_split(p, grid_col + 1, grid_dim),
+			reinterpret_cast<T*>(segment + layout.rhs_block_offset + w * layout.col_panel_size));
+	}
+
+	//fork a worker for each block of the result, sharing the hardware
+	//threads between them
+	const unsigned hw_threads = std::thread::hardware_concurrency();
+	const unsigned worker_threads = hw_threads > num_workers ? hw_threads / num_workers : 1;
+	std::vector<pid_t> workers;
+	bool failed = false;
+	for (unsigned w = 0;w<num_workers;++w){
+		pid_t pid = fork();
+		if (pid == 0){
+			//a worker must never return into the caller's code
+			try{
+				ThreadPool<T>::set_thread_limit(worker_threads);
+				summa_worker<T>(segment, layout, grid_dim, w / grid_dim, w % grid_dim);
+			}
+			catch(...){
+				_exit(1);
+			}
+			_exit(0);
+		}
+		else if (pid < 0){
+			failed = true;
+			break;
+		}
+		workers.push_back(pid);
+	}
+
+	//reap only our own workers. A missing or dead worker leaves the others
+	//blocked on the barrier, so the ones still running are killed as soon
+	//as one fails
+	std::vector<bool> reaped (workers.size(), false);
+	unsigned num_running = workers.size();
+	if (failed){
+		for (unsigned i = 0;i<workers.size();++i){
+			kill(workers[i], SIGKILL);
+		}
+	}
+	while (num_running > 0){
+		bool any_reaped = false;
+		for (unsigned i = 0;i<workers.size();++i){
+			if (reaped[i]){
+				continue;
+			}
+			int exit_status = 0;
+			pid_t pid = waitpid(workers[i], &exit_status, WNOHANG);
+			if (pid == 0){
+				continue;
+			}
+			reaped[i] = true;
+			any_reaped = true;
+			--num_running;
+			if (!failed && (pid < 0 || !WIFEXITED(exit_status)
+				|| WEXITSTATUS(exit_status) != 0)){
+				failed = true;
+				for (unsigned j = 0;j<workers.size();++j){
+					if (!reaped[j]){
+						kill(workers[j], SIGKILL);
+					}
+				}
+			}
+		}
+		if (!any_reaped){
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	Matrix<T> result (m, p);
+	if (!failed && p > 0){
+		const T* shared_result = reinterpret_cast<T*>(segment + layout.result_offset);
+		for (unsigned i = 0;i<m;++i){
+			std::memcpy(result.m_data[i].data(), shared_result + size_t(i) * p,
+				sizeof(T) * p);
+		}
+	}
+	//every worker has been reaped, so none can still be using the barrier
+	pthread_barrier_destroy(barrier);
+	munmap(mapped, layout.total_size);
+	if (failed){
+		std::cerr << "A worker process failed during distributed multiply" << std::endl;
+		throw;
+	}
+	return result;
+}
+#endif
@@ -9,9 +9,11 @@
 #include <mutex>
 #include <atomic>
 #include <iostream>
+#include <memory>
 #include "Job.h"
 #include "JobQueue.h"
 #include "ThreadPool.h"
+#include "PackedCache.h"
 
 /* 
 Build Instuctions: g++ main_matrix.cpp -std="c++11" -pthread
@@ -27,6 +29,12 @@ template <class T> void
 call_transpose_one(Matrix<T>*& obj, Matrix<T>*& result, Matrix<T>*& other, unsigned row_index );
 template <class T> void
 call_mult_one(Matrix<T>*& obj, Matrix<T>*& result, Matrix<T>*& rhs, unsigned row_index);
+struct SummaLayout;
+template <class T> void
+summa_worker(char* segment, const SummaLayout& layout, unsigned grid_dim,
+	unsigned grid_row, unsigned grid_col);
+template <class T> Matrix<T>
+summa_mult(Matrix<T>& lhs, Matrix<T>& rhs, unsigned grid_dim);
 
 
 /*
@@ -48,6 +56,7 @@ public:
 	Matrix (size_type num_rows, size_type num_cols, const T& fill_val);  
 	Matrix& operator=(const Matrix& other); //copy assignment operator
 	Matrix& operator=(Matrix&& other);      //move assignment operator
+	~Matrix();                              //destructor
 	bool operator== (const Matrix<T>& rhs) const;
 
 	//ACCESSORS 
@@ -60,35 +69,58 @@ public:
 		std::lock_guard<std::mutex> lck (m_matrix_mtx);
 		return m_num_cols;
 	}
+	//Changes whenever the Matrix is modified. Never shared by two Matrix<T>
+	//objects, so it identifies the current contents of this Matrix.
+	unsigned long long version() const {
+		std::lock_guard<std::mutex> lck (m_matrix_mtx);
+		return m_version;
+	}
 	
 	//OPERATIONS
 	void push_row(std::vector<T>& a_row);
 	Matrix operator*(const Matrix& other) const ;
-	Matrix fast_mult( Matrix& other);
+	//num_threads of 0 uses one thread per hardware thread
+	Matrix fast_mult( Matrix& other, unsigned num_threads = 0);
 	Matrix transpose() const ;
-	Matrix transpose( const char& type);
+	Matrix transpose( const char& type, unsigned num_threads = 0);
 	
 private:
 	std::vector<std::vector<T> > m_data; 
 	size_type m_num_rows;
 	size_type m_num_cols;
+	unsigned long long m_version; //stamped from next_version() on every change
+	//transposed copy of this Matrix, only set while it is the rhs of fast_mult
+	std::shared_ptr<const std::vector<T> > m_packed_cols;
+	//true once fast_mult may have cached a packed copy of this version, so
+	//matrices that were never packed don't touch the cache
+	bool m_in_packed_cache;
 	//Mutable to allow const functions to lock/unlock it on const objects
 	mutable std::mutex m_matrix_mtx;
 
 	//HELPERS
+	static unsigned long long next_version();
+	void replace_version();
+	void drop_packed();
+	std::shared_ptr<const std::vector<T> > pack_columns() const;
 	void mult_one( Matrix*& result,  Matrix*& rhs,size_type row_index);
 	void transpose_one(Matrix*& result, size_type row_index ) ;
 	friend void call_transpose_one<T>(Matrix<T>*& obj, 
 		Matrix<T>*& result, Matrix<T>*& other, unsigned row_index);	
 	friend void call_mult_one<T>(Matrix<T>*& obj, Matrix<T>*& result, 
 		Matrix<T>*& rhs, size_type row_index);
+	//multi-process multiply, see DistributedMult.h
+	friend void summa_worker<T>(char* segment, const SummaLayout& layout,
+		unsigned grid_dim, unsigned grid_row, unsigned grid_col);
+	friend Matrix<T> summa_mult<T>(Matrix<T>& lhs, Matrix<T>& rhs, unsigned grid_dim);
 };	
 
 //Default Constructor: creates empty Matrix
 template <class T> 
 Matrix<T>::Matrix() :
 	m_num_rows(0),
-	m_num_cols (0)
+	m_num_cols (0),
+	m_version(next_version()),
+	m_in_packed_cache(false)
 {
 }
 
@@ -96,9 +128,11 @@ Matrix<T>::Matrix() :
 template <class T> 
 Matrix<T>::Matrix(const Matrix& other){
 	std::lock_guard<std::mutex> other_lck (other.m_matrix_mtx);
-	m_data(other.m_data);
+	m_data = other.m_data;
 	m_num_rows = other.m_num_rows;
 	m_num_cols = other.m_num_cols;
+	m_version = next_version();
+	m_in_packed_cache = false;
 }   
 
 //Move Constructor
@@ -108,9 +142,14 @@ Matrix<T>::Matrix(Matrix&& other){
 	m_data = other.m_data;
 	m_num_rows = other.m_num_rows;
 	m_num_cols = other.m_num_cols;
+	//same contents, so the version (and any packed copy) moves with them
+	m_version = other.m_version;
+	m_in_packed_cache = other.m_in_packed_cache;
 	other.m_data = std::vector<std::vector<T> >();
 	other.m_num_rows = 0;
 	other.m_num_cols = 0;
+	other.m_version = next_version();
+	other.m_in_packed_cache = false;
 }
 
 //Default Fill Constructor (No val provided)
@@ -119,6 +158,8 @@ Matrix<T>::Matrix(size_type num_rows, size_type num_cols){
 	m_data = std::vector<std::vector<T> >(num_rows,std::vector<T>(num_cols) );
 	m_num_rows = num_rows;
 	m_num_cols = num_cols;
+	m_version = next_version();
+	m_in_packed_cache = false;
 }
 
 //Fill Constructor: fills with preset row and column size and fill values
@@ -127,6 +168,8 @@ Matrix<T>::Matrix(size_type num_rows, size_type num_cols, const T& fill_val){
 	m_data = std::vector<std::vector<T> >(num_rows,std::vector<T>( num_cols,fill_val) );
 	m_num_rows = num_rows;
 	m_num_cols = num_cols;
+	m_version = next_version();
+	m_in_packed_cache = false;
 }
 
 //Copy Assignment Operator
@@ -139,6 +182,7 @@ Matrix<T>& Matrix<T>::operator=(const Matrix& other){
 		m_data = other.m_data;
 		m_num_rows = other.m_num_rows;
 		m_num_cols = other.m_num_cols;
+		replace_version();
 	}
 	return *this;
 }
@@ -152,13 +196,25 @@ Matrix<T>& Matrix<T>::operator=(Matrix&& other){
 		m_data = other.m_data;
 		m_num_rows = other.m_num_rows;
 		m_num_cols = other.m_num_cols;
+		//same contents, so the version (and any packed copy) moves with them
+		drop_packed();
+		m_version = other.m_version;
+		m_in_packed_cache = other.m_in_packed_cache;
 		other.m_data = std::vector<std::vector<T> >();
 		other.m_num_rows = 0;
 		other.m_num_cols = 0;
+		other.m_version = next_version();
+		other.m_in_packed_cache = false;
 	}
 	return *this;
 }
 
+//Destructor: drops the packed copy of this Matrix, if there is one
+template <class T>
+Matrix<T>::~Matrix(){
+	drop_packed();
+}
+
 //Prints out each row of the Matrix.
 template <class T>
 void Matrix<T>::print() const{
@@ -180,6 +236,7 @@ void Matrix<T>::push_row(std::vector<T>& a_row){
 	if ((m_num_cols == 0 && m_num_cols == 0) || m_num_cols == a_row.size()){
 		m_data.push_back(a_row);
 		++m_num_rows;
+		replace_version();
 	}
 	else{
 		std::cerr <<"Unable to push row onto Matrix" << std::endl;
@@ -239,7 +296,7 @@ Matrix<T> Matrix<T>::operator*(const Matrix& other) const {
 
 //Multiplies the matrices using multiple threads to increase efficiency
 template <class T>
-Matrix<T> Matrix<T>::fast_mult( Matrix& other) {
+Matrix<T> Matrix<T>::fast_mult( Matrix& other, unsigned num_threads) {
 	if (this == &other){
 			std::cerr << "Incompatible: cannot multiply self" << std::endl;
 			throw;	
@@ -258,22 +315,41 @@ Matrix<T> Matrix<T>::fast_mult( Matrix& other) {
 	Matrix result (m_num_rows, other.m_num_cols);
 	Matrix* ptr_result = &result;
 	Matrix* ptr_other = &other;
-	JobQueue<T> job_queue;
-	//create a Job targeting each row of this matrix
-	for (size_type i = 0;i<m_num_rows;++i){
-		std::function<void(Matrix*&, Matrix*&, Matrix*&, unsigned)> f (call_mult_one<T>);
-		job_queue.push(Job<T>(f,this, ptr_result, ptr_other, i));
+	//the packed rhs must not outlive this call, even if it throws, or it
+	//would be held outside the cache's budget
+	try{
+		//reuse the packed rhs from an earlier call if it hasn't changed since
+		PackedCache<T>& cache = PackedCache<T>::instance();
+		other.m_packed_cols = cache.find(other.m_version);
+		if (!other.m_packed_cols){
+			other.m_packed_cols = other.pack_columns();
+			other.m_in_packed_cache = true;
+			cache.insert(other.m_version, other.m_packed_cols);
+		}
+
+		JobQueue<T> job_queue;
+		//create a Job targeting each row of this matrix
+		for (size_type i = 0;i<m_num_rows;++i){
+			std::function<void(Matrix*&, Matrix*&, Matrix*&, unsigned)> f (call_mult_one<T>);
+			job_queue.push(Job<T>(f,this, ptr_result, ptr_other, i));
+		}
+		std::condition_variable notify_when_finished;
+		std::mutex this_thread_mtx;
+		std::unique_lock<std::mutex> this_thread_lck (this_thread_mtx) ;
+		ThreadPool<T> pool (job_queue, this_thread_mtx, notify_when_finished, 
+			num_threads);
+		//wait until we're notifed the thread pool is done doing work 
+		while(!pool.isDone()){
+			notify_when_finished.wait(this_thread_lck);
+		}
+		this_thread_lck.unlock();
+		pool.join_all();
 	}
-	std::condition_variable notify_when_finished;
-	std::mutex this_thread_mtx;
-	std::unique_lock<std::mutex> this_thread_lck (this_thread_mtx) ;
-	ThreadPool<T> pool (job_queue, this_thread_mtx, notify_when_finished );
-	//wait until we're notifed the thread pool is done doing work 
-	while(!pool.isDone()){
-		notify_when_finished.wait(this_thread_lck);
+	catch(...){
+		other.m_packed_cols.reset();
+		throw;
 	}
-	this_thread_lck.unlock();
-	pool.join_all();
+	other.m_packed_cols.reset();
 	return result;
 
 }
@@ -282,19 +358,65 @@ Matrix<T> Matrix<T>::fast_mult( Matrix& other) {
 	Helper function that takes a single row (row_index) of this Matrix and 
 	multiplies it with each column of the rhs Matrix. Stores the result of the
 	operation in the result pointer Matrix. Used in a JobQueue to give each
-	thread a row to target. 
+	thread a row to target. Columns are read from rhs->m_packed_cols so
+	both operands are walked contiguously.
 */
 template <class T>
 void Matrix<T>::mult_one( Matrix*& result, Matrix*& rhs, size_type row_index) {
+	const std::vector<T>& a_row = m_data[row_index];
+	const T* packed = rhs->m_packed_cols->data();
 	for (size_type i = 0;i<rhs->m_num_cols;++i){
+		const T* a_col = packed + size_t(i) * rhs->m_num_rows;
 		T sum = T();
 		for (size_type j=0;j<rhs->m_num_rows;++j){
-			sum += (m_data[row_index][j] * (rhs->m_data[j][i]));
+			sum += (a_row[j] * a_col[j]);
 		}
 		result->m_data[row_index][i] = sum;
 	}
 }
 
+/*
+	Returns the columns of this Matrix stored one after another in a single
+	buffer, i.e. its transpose in row-major order. Caller must hold
+	m_matrix_mtx.
+*/
+template <class T>
+std::shared_ptr<const std::vector<T> > Matrix<T>::pack_columns() const {
+	std::shared_ptr<std::vector<T> > packed =
+		std::make_shared<std::vector<T> >(size_t(m_num_rows) * m_num_cols);
+	for (size_type i = 0;i<m_num_rows;++i){
+		for (size_type j = 0;j<m_num_cols;++j){
+			(*packed)[size_t(j) * m_num_rows + i] = m_data[i][j];
+		}
+	}
+	return packed;
+}
+
+//Returns a version no other Matrix<T> has had
+template <class T>
+unsigned long long Matrix<T>::next_version() {
+	static std::atomic<unsigned long long> counter (0);
+	return ++counter;
+}
+
+//Gives this modified Matrix a new version and drops the packed copy of its
+//old contents. Caller must hold m_matrix_mtx.
+template <class T>
+void Matrix<T>::replace_version() {
+	drop_packed();
+	m_version = next_version();
+}
+
+//Erases the packed copy of this version from the cache if fast_mult may
+//have stored one.
+template <class T>
+void Matrix<T>::drop_packed() {
+	if (m_in_packed_cache){
+		PackedCache<T>::instance().erase(m_version);
+		m_in_packed_cache = false;
+	}
+}
+
 
 /*
 	Returns a tranposed version of the current Matrix using a single threaded
@@ -317,7 +439,7 @@ Matrix<T> Matrix<T>::transpose() const {
 	an excpetion is thrown.
 */
 template <class T> 
-Matrix<T> Matrix<T>::transpose(const char& type)  {
+Matrix<T> Matrix<T>::transpose(const char& type, unsigned num_threads)  {
 	if (type == 'm'){
 		std::lock_guard<std::mutex> mtx_lck (m_matrix_mtx);
 		//create an empty matrix with a switched number of rows and columns as
@@ -334,7 +456,8 @@ Matrix<T> Matrix<T>::transpose(const char& type)  {
 		std::condition_variable notify_when_finished;
 		std::mutex this_thread_mtx;
 		std::unique_lock<std::mutex> this_thread_lck (this_thread_mtx) ;
-		ThreadPool<T> pool (job_queue, this_thread_mtx, notify_when_finished );
+		ThreadPool<T> pool (job_queue, this_thread_mtx, notify_when_finished, 
+			num_threads);
 		//wait until we're notifed the thread pool is done doing work 
 		while(!pool.isDone()){
 			notify_when_finished.wait(this_thread_lck);
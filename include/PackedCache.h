@@ -0,0 +1,132 @@
+#ifndef __pc_h__
+#define __pc_h__
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <unordered_map>
+#include <cstddef>
+
+/*	Thread-safe LRU cache of packed right hand side operands used by
+	Matrix::fast_mult. Entries are keyed by the Matrix version, which is
+	unique across every Matrix<T> and changes whenever a Matrix is
+	modified, so a stale entry can never be returned. A Matrix also erases
+	its entry when it is modified or destroyed, so dead entries don't use
+	up the budget, which bounds the total size of the cached buffers.
+*/
+template <class T>
+class PackedCache{
+public:
+	typedef std::shared_ptr<const std::vector<T> > packed_ptr;
+
+	//Returns the cache shared by all Matrix<T> objects. It is never
+	//destroyed, so Matrix objects with static storage can still use it
+	//from their destructors.
+	static PackedCache& instance(){
+		static PackedCache* cache = new PackedCache;
+		return *cache;
+	}
+
+	//Returns the packed buffer stored for version, or an empty pointer if
+	//there is none. A hit marks the entry as most recently used.
+	packed_ptr find(unsigned long long version){
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		typename std::unordered_map<unsigned long long,
+			typename std::list<Entry>::iterator>::iterator it = m_index.find(version);
+		if (it == m_index.end()){
+			return packed_ptr();
+		}
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return it->second->m_packed;
+	}
+
+	//Stores packed under version, evicting the least recently used entries
+	//until it fits. Buffers larger than the whole budget are not stored.
+	void insert(unsigned long long version, packed_ptr packed){
+		const size_t bytes = packed->size() * sizeof(T);
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		if (bytes > m_budget || m_index.count(version)){
+			return;
+		}
+		m_entries.push_front(Entry(version, packed, bytes));
+		m_index[version] = m_entries.begin();
+		m_bytes_used += bytes;
+		evict();
+	}
+
+	//Removes the entry stored for version, if any. Called when the Matrix
+	//with that version is modified or destroyed.
+	void erase(unsigned long long version){
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		typename std::unordered_map<unsigned long long,
+			typename std::list<Entry>::iterator>::iterator it = m_index.find(version);
+		if (it == m_index.end()){
+			return;
+		}
+		m_bytes_used -= it->second->m_bytes;
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+
+	//Sets the byte budget, evicting entries if it shrank
+	void set_budget(size_t bytes){
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		m_budget = bytes;
+		evict();
+	}
+
+	//Returns the byte budget
+	size_t budget() const{
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		return m_budget;
+	}
+
+	//Removes every entry
+	void clear(){
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		m_entries.clear();
+		m_index.clear();
+		m_bytes_used = 0;
+	}
+
+	//Returns the number of bytes held by cached buffers
+	size_t bytes_used() const{
+		std::lock_guard<std::mutex> cache_lck (m_cache_mtx);
+		return m_bytes_used;
+	}
+
+private:
+	struct Entry{
+		Entry(unsigned long long version, packed_ptr packed, size_t bytes):
+			m_version(version), m_packed(packed), m_bytes(bytes)
+		{
+		}
+		unsigned long long m_version;
+		packed_ptr m_packed;
+		size_t m_bytes;
+	};
+
+	PackedCache(): m_budget(64 << 20), m_bytes_used(0)
+	{
+	}
+	PackedCache(const PackedCache& other);
+	PackedCache& operator=(const PackedCache& other);
+
+	//Drops least recently used entries until the budget is met.
+	//Caller must hold m_cache_mtx.
+	void evict(){
+		while (m_bytes_used > m_budget && !m_entries.empty()){
+			m_bytes_used -= m_entries.back().m_bytes;
+			m_index.erase(m_entries.back().m_version);
+			m_entries.pop_back();
+		}
+	}
+
+	std::list<Entry> m_entries; //most recently used first
+	std::unordered_map<unsigned long long, typename std::list<Entry>::iterator> m_index;
+	size_t m_budget;     //maximum bytes of cached buffers
+	size_t m_bytes_used; //bytes of cached buffers
+	mutable std::mutex m_cache_mtx;
+};
+#endif
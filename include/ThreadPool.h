@@ -10,6 +10,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <cstdlib>
+#include <cassert>
 
 /*	Creates threads to do the work stored in the JobQueue object 
 	it is constructed with. Returns control to calling thread once all
@@ -23,8 +24,9 @@ template <class T>
 class ThreadPool{
 
 public:
+	//num_threads of 0 creates one thread per hardware thread
 	ThreadPool(JobQueue<T>& jq, std::mutex& mtx, 
-		std::condition_variable& work_done_flag):
+		std::condition_variable& work_done_flag, unsigned num_threads = 0):
 
 		m_job_queue(jq), m_calling_thread_mtx(mtx),  
 		m_work_done_cv(work_done_flag), m_done(false), m_all_jobs_loaded(false),
@@ -32,14 +34,22 @@ public:
 
 		{	
 			m_num_jobs_assigned = m_job_queue.size();
-			//create as many threads as this machine is capable of running concurrently
-			const unsigned m_thread_count = std::thread::hardware_concurrency();
+			//create as many threads as asked for, or as this machine is capable
+			//of running concurrently, unless a lower limit has been set
+			m_thread_count = num_threads != 0 ? num_threads 
+				: std::thread::hardware_concurrency();
+			if (m_thread_count == 0){
+				m_thread_count = 1;
+			}
+			if (thread_limit() != 0 && thread_limit() < m_thread_count){
+				m_thread_count = thread_limit();
+			}
 			try{
 				for (unsigned i=0;i<m_thread_count;++i){
 					m_threads.push_back(
 						std::thread(&ThreadPool::worker_thread,this));	
 				}
-				assert(m_threads.size() == 4);
+				assert(m_threads.size() == m_thread_count);
 				m_all_jobs_loaded = true;
 			}
 			catch(...){
@@ -56,9 +66,13 @@ public:
 	*/ 
 	bool isDone()  {return unsigned(m_done);}
 
+	//Caps the number of threads of every ThreadPool created afterwards in
+	//this process. 0 removes the cap.
+	static void set_thread_limit(unsigned limit){ thread_limit() = limit; }
+
 	//Joins all joinable threads in the pool.
 	void join_all(){
-		assert(m_threads.size() == 4);
+		assert(m_threads.size() == m_thread_count);
 		for(unsigned i=0;i<m_threads.size();++i){
 			if (m_threads[i].joinable() ){
 				m_threads[i].join();
@@ -116,6 +130,11 @@ public:
 	}
 
 private:
+	static std::atomic<unsigned>& thread_limit(){
+		static std::atomic<unsigned> limit (0);
+		return limit;
+	}
+
 	unsigned m_thread_count; //number of threads to create
 	std::atomic<bool> m_done; //notifies all threads in pool all work is done
 	std::vector<std::thread> m_threads;
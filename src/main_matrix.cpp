@@ -5,7 +5,13 @@
 #include <cassert>
 #include <utility>
 #include "Matrix.h"
+#include "DistributedMult.h"
+#include "AutoTune.h"
 #include <time.h>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <typeinfo>
 
 void get_start_time(std::chrono::high_resolution_clock::time_point& start){
 	start= std::chrono::high_resolution_clock::now();
@@ -44,6 +50,14 @@ void test_transpose(int num_cols, int num_rows){
 	elapsed = finish-start;
 	assert(c==b);
 	std::cout << "MultiThreaded Transpose Time: " << elapsed.count() << std::endl;
+
+ //Chosen by the AutoTuner
+	get_start_time(start);
+	c = std::move(auto_transpose(a));
+	get_finish_time(finish);
+	elapsed = finish-start;
+	assert(c==b);
+	std::cout << "AutoTuned Transpose Time: " << elapsed.count() << std::endl;
 }
 
 //tests and prints some specific and easy to confrim examples
@@ -67,12 +81,233 @@ void test_mult(int mat_a_cols, int mat_a_rows, int mat_b_cols){
 	get_finish_time(finish);
 	elapsed = finish - start;
 	std::cout << "MultiThread: " << elapsed.count() << std::endl;
+	get_start_time(start);
+	Matrix<int> c_mat = std::move(auto_mult(a_mat, b_mat));
+	get_finish_time(finish);
+	elapsed = finish - start;
+	assert(c_mat==(a_mat*b_mat));
+	std::cout << "AutoTuned: " << elapsed.count() << std::endl;
+
+}
+//Checks the AutoTuner's dispatch decisions and thread counts, the tuning
+//file round trip, old and malformed entries and the MATRIX_TUNING_FILE
+//override. Restores the tuning it started with.
+void test_auto_tune(){
+	AutoTuner<int>& tuner = AutoTuner<int>::instance();
+	const std::string type_name = typeid(int).name();
+	const std::string saved_file = "test_tuning_saved.txt";
+	const std::string tuning_file = "test_tuning.txt";
+	assert(tuner.save(saved_file));
+
+	//the environment variable names the tuning file
+	setenv("MATRIX_TUNING_FILE", tuning_file.c_str(), 1);
+	assert(AutoTuner<int>::tuning_file() == tuning_file);
+	{
+		std::ofstream out (tuning_file.c_str());
+		out << "other_type 1 2" << std::endl;
+		out << type_name << " 100 200 3 2" << std::endl;
+	}
+	assert(tuner.load(AutoTuner<int>::tuning_file()));
+	assert(tuner.use_threaded_mult(4, 5, 5));
+	assert(!tuner.use_threaded_mult(4, 4, 4));
+	assert(tuner.use_threaded_transpose(10, 20));
+	assert(!tuner.use_threaded_transpose(10, 19));
+	assert(tuner.mult_threads() == 3 && tuner.transpose_threads() == 2);
+
+	//both paths of the dispatcher give the right answer
+	Matrix<int> a_mat(4, 5, 2);
+	Matrix<int> b_mat(5, 5, 3);
+	Matrix<int> c_mat = std::move(auto_mult(a_mat, b_mat));
+	assert(c_mat==(a_mat*b_mat));
+	Matrix<int> small_b(5, 1, 3);
+	c_mat = std::move(auto_mult(a_mat, small_b));
+	assert(c_mat==(a_mat*small_b));
+	c_mat = std::move(auto_transpose(a_mat));
+	assert(c_mat==a_mat.transpose());
+	Matrix<int> large_a(10, 20, 4);
+	c_mat = std::move(auto_transpose(large_a));
+	assert(c_mat==large_a.transpose());
+
+	//saving keeps other types' lines and reloads to the same thresholds
+	assert(tuner.save(tuning_file));
+	assert(tuner.load(tuning_file));
+	assert(tuner.use_threaded_mult(4, 5, 5) && !tuner.use_threaded_mult(4, 4, 4));
+	assert(tuner.mult_threads() == 3 && tuner.transpose_threads() == 2);
+	{
+		std::ifstream in (tuning_file.c_str());
+		std::string first_line, second_line;
+		std::getline(in, first_line);
+		std::getline(in, second_line);
+		assert(first_line == "other_type 1 2" || second_line == "other_type 1 2");
+	}
+
+	//a malformed or missing entry leaves the tuning unchanged
+	{
+		std::ofstream out (tuning_file.c_str());
+		out << type_name << " not_a_number 5" << std::endl;
+	}
+	assert(!tuner.load(tuning_file));
+	assert(tuner.use_threaded_mult(4, 5, 5) && !tuner.use_threaded_mult(4, 4, 4));
+	{
+		std::ofstream out (tuning_file.c_str());
+		out << type_name << " 100 200 3" << std::endl;
+	}
+	assert(!tuner.load(tuning_file));
+	assert(tuner.mult_threads() == 3 && tuner.transpose_threads() == 2);
+	assert(!tuner.load("no_such_tuning_file.txt"));
+	assert(tuner.use_threaded_mult(4, 5, 5) && !tuner.use_threaded_mult(4, 4, 4));
+
+	//a line without thread counts uses every hardware thread
+	{
+		std::ofstream out (tuning_file.c_str());
+		out << type_name << " 100 200" << std::endl;
+	}
+	assert(tuner.load(tuning_file));
+	assert(tuner.mult_threads() == 0 && tuner.transpose_threads() == 0);
+
+	unsetenv("MATRIX_TUNING_FILE");
+	assert(tuner.load(saved_file));
+	std::remove(tuning_file.c_str());
+	std::remove(saved_file.c_str());
+	std::cout << "AutoTuner tests passed" << std::endl;
+}
+
+//Multiplies several left operands by the same rhs so every fast_mult after
+//the first reuses the cached packed rhs, then checks that modified, moved
+//and destroyed matrices and the byte budget keep the cache in step.
+//All dimensions must be nonzero.
+void test_cached_mult(int mat_a_cols, int mat_a_rows, int mat_b_cols, unsigned num_lhs){
+	std::chrono::high_resolution_clock::time_point start;
+	std::chrono::high_resolution_clock::time_point finish;
+	std::chrono::duration<double> elapsed;
+	PackedCache<int>& cache = PackedCache<int>::instance();
+	const size_t packed_bytes = size_t(mat_a_cols) * mat_b_cols * sizeof(int);
+	cache.clear();
+
+	Matrix<int> b_mat(mat_a_cols, mat_b_cols, 3);
+	std::cout<< "----------------------------------" << std::endl;
+	std::cout <<"Repeated rhs: " << num_lhs << " x ( " << mat_a_rows << "," << mat_a_cols <<
+		" )" << " x " << "( " << mat_a_cols << "," << mat_b_cols << " )" << std::endl;
+	for (unsigned i = 0;i<num_lhs;++i){
+		Matrix<int> a_mat(mat_a_rows, mat_a_cols, i);
+		get_start_time(start);
+		Matrix<int> c = std::move(a_mat.fast_mult(b_mat));
+		get_finish_time(finish);
+		elapsed = finish - start;
+		assert(c==(a_mat*b_mat));
+		//packed once on the first call and reused afterwards
+		assert(cache.bytes_used() == packed_bytes);
+		std::cout << "MultiThread call " << i << ": " << elapsed.count() << std::endl;
+	}
+	Matrix<int> a_mat(mat_a_rows, mat_a_cols, 5);
+
+	//moving keeps the contents and so the packed copy
+	Matrix<int> moved_b = std::move(b_mat);
+	Matrix<int> c = std::move(a_mat.fast_mult(moved_b));
+	assert(cache.bytes_used() == packed_bytes);
+
+	//modifying drops the packed copy of the old contents
+	unsigned long long old_version = moved_b.version();
+	moved_b = Matrix<int>(mat_a_cols, mat_b_cols, 7);
+	assert(moved_b.version() != old_version);
+	assert(cache.bytes_used() == 0);
+	c = std::move(a_mat.fast_mult(moved_b));
+	assert(c==(a_mat*moved_b));
+
+	//destroying drops it as well
+	{
+		Matrix<int> temp_b(mat_a_cols, mat_b_cols, 1);
+		c = std::move(a_mat.fast_mult(temp_b));
+		assert(cache.bytes_used() == 2 * packed_bytes);
+	}
+	assert(cache.bytes_used() == packed_bytes);
+
+	//with room for two entries the least recently used one is evicted
+	const size_t old_budget = cache.budget();
+	cache.set_budget(2 * packed_bytes);
+	Matrix<int> other_b(mat_a_cols, mat_b_cols, 2);
+	Matrix<int> third_b(mat_a_cols, mat_b_cols, 4);
+	c = std::move(a_mat.fast_mult(other_b));
+	c = std::move(a_mat.fast_mult(moved_b));
+	c = std::move(a_mat.fast_mult(third_b));
+	assert(c==(a_mat*third_b));
+	assert(cache.bytes_used() == 2 * packed_bytes);
+	assert(!cache.find(other_b.version()));
+	assert(cache.find(moved_b.version()) && cache.find(third_b.version()));
+
+	//shrinking the budget evicts, and nothing larger than it is cached
+	cache.set_budget(packed_bytes - 1);
+	assert(cache.bytes_used() == 0);
+	c = std::move(a_mat.fast_mult(other_b));
+	assert(c==(a_mat*other_b));
+	assert(cache.bytes_used() == 0);
+	cache.set_budget(old_budget);
+
+	//pushing a row drops the packed copy too
+	c = std::move(a_mat.fast_mult(third_b));
+	assert(cache.bytes_used() == packed_bytes);
+	std::vector<int> a_row (mat_b_cols, 1);
+	third_b.push_row(a_row);
+	assert(cache.bytes_used() == 0);
+}
+
+//Runs a multi-process SUMMA multiply on a grid_dim x grid_dim process grid
+//and confirms it matches the single threaded result.
+void test_dist_mult(int mat_a_cols, int mat_a_rows, int mat_b_cols, unsigned grid_dim){
+	std::chrono::high_resolution_clock::time_point start;
+	std::chrono::high_resolution_clock::time_point finish;
+	std::chrono::duration<double> elapsed;
 
+	//random entries so a misplaced block would change the result
+	Matrix<int> a_mat(0, mat_a_cols);
+	Matrix<int> b_mat(mat_a_cols, mat_b_cols, 3);
+	for (int i = 0;i<mat_a_rows;++i){
+		std::vector<int> a_row (mat_a_cols);
+		for (int j = 0;j<mat_a_cols;++j){
+			a_row[j] = rand() % 10;
+		}
+		a_mat.push_row(a_row);
+	}
+	std::cout<< "----------------------------------" << std::endl;
+	std::cout <<"Distributed Multiplying: " << "( " << mat_a_rows << "," << mat_a_cols <<" )" <<
+		" x " << "( " << mat_a_cols << "," << mat_b_cols << " ) on a " << grid_dim <<
+		" x " << grid_dim << " process grid" << std::endl;
+	get_start_time(start);
+	Matrix<int> expected = std::move(a_mat*b_mat);
+	get_finish_time(finish);
+	elapsed = finish - start;
+	std::cout << "SingleThread: " << elapsed.count() <<std::endl;
+	//an unrelated child of the caller must be left for the caller to reap
+	pid_t unrelated = fork();
+	if (unrelated == 0){
+		_exit(3);
+	}
+	get_start_time(start);
+	Matrix<int> c = std::move(summa_mult(a_mat, b_mat, grid_dim));
+	get_finish_time(finish);
+	elapsed = finish - start;
+	assert(c==expected);
+	int unrelated_status = 0;
+	pid_t reaped = waitpid(unrelated, &unrelated_status, 0);
+	assert(reaped == unrelated && WEXITSTATUS(unrelated_status) == 3);
+	std::cout << "MultiProcess: " << elapsed.count() << std::endl;
 }
-int main()
+
+int main(int argc, char** argv)
 	//seed
 {	srand(time(NULL));
 
+	//"tune" calibrates the AutoTuner on this machine and saves the result
+	if (argc > 1 && std::string(argv[1]) == "tune"){
+		AutoTuner<int>& tuner = AutoTuner<int>::instance();
+		tuner.calibrate();
+		if (!tuner.save(AutoTuner<int>::tuning_file())){
+			return 1;
+		}
+		std::cout << "saved tuning to " << AutoTuner<int>::tuning_file() << std::endl;
+		return 0;
+	}
+
 	unsigned num_trials = 20; // <--number of times to run the transpose test,
 	for(unsigned i = 0;i<num_trials;++i){
 		test_transpose(rand() % 100,rand() % 100);
@@ -87,6 +322,16 @@ int main()
 	for (unsigned i =0;i<num_trials;++i){
 		test_mult(rand()%700,rand()%700,rand()%700); 
 	}
+	test_auto_tune();
+	test_cached_mult(rand()%300+1,rand()%300+1,rand()%300+1, 4);
+	for (unsigned i = 1;i<4;++i){
+		test_dist_mult(rand()%300,rand()%300,rand()%300, i);
+	}
+	//inner dimension smaller than the grid, and empty operands or result
+	test_dist_mult(3, 2, 4, 4);
+	test_dist_mult(0, 3, 4, 2);
+	test_dist_mult(4, 3, 0, 2);
+	test_dist_mult(4, 0, 3, 2);
 	Matrix<int> m;
 
 	//empty matrix transpose and print test (shouldn't print anything)